@@ -0,0 +1,472 @@
+// Native batch benchmark for the axis -> packet motion pipeline.
+//
+// Runs the same processing as NimbleTCode::updateActuator (axis mapping, vibration,
+// safety supervisor, slew clamp and packet encoding) over recorded or synthetic sessions,
+// spread across all cores. Reports ticks/sec and supervisor reaction times, and compares
+// every packet against a golden baseline.
+//
+//   pio run -e bench && .pio/build/bench/program [options]
+//
+//   --session FILE        Recorded session (repeatable). CSV rows: ms,L0,V0,A0,A1,A2[,temp,fault,missing[,stopped]]
+//                         Values are held until the next row. Lines starting with # are ignored.
+//                         The optional columns (0 or 1) simulate the actuator status replies and
+//                         the device being stopped. A header row starting with "ms," sets the
+//                         columns of the rows after it, in any order and including A3 (slew),
+//                         e.g. ms,L0,V0,A0,A1,A2,A3,temp,fault,missing,stopped. Columns not
+//                         named keep their defaults.
+//   --synthetic N         Number of synthetic sessions (default 256 when no --session given)
+//   --ticks N             Ticks per synthetic session (default 30000, 1 minute of packets)
+//   --seed N              Seed for synthetic sessions (default 1)
+//   --threads N           Worker threads (default: all cores)
+//   --write-golden FILE   Save all packets as the golden baseline
+//   --golden FILE         Compare all packets against a golden baseline (exit code 1 on diffs)
+//   --max-diffs N         Number of packet diffs to print (default 10)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "nimbleMotion.h"
+
+#define TICK_MILLIS 2 // SEND_INTERVAL in the firmware
+#define GOLDEN_MAGIC "NMBG"
+#define GOLDEN_VERSION 1
+
+// Simulated actuator replies and run state
+struct actuatorStatus {
+    bool tempLimiting = false;
+    bool sensorFault = false;
+    bool missing = false; // No replies
+    bool stopped = false; // Device stopped with the encoder button
+};
+
+struct sessionRow {
+    uint32_t ms;
+    nimbleAxisValues axes;
+    actuatorStatus status;
+};
+
+// Either a recorded session (rows) or a synthetic one generated from its seed.
+struct session {
+    std::string name;
+    std::vector<sessionRow> rows;
+    uint32_t ticks = 0;
+    uint64_t seed = 0;
+};
+
+struct sessionResult {
+    uint64_t hash = 0;
+    uint32_t packets = 0;
+    uint32_t events = 0;          // Supervisor events (temp, fault, missing)
+    int32_t maxReactionTicks = -1; // Event to first de-rated packet
+    int64_t maxReactionMicros = -1; // Same, on the simulated clock
+    std::vector<uint8_t> data; // Only kept when comparing or writing a golden baseline
+};
+
+// Deterministic generator so synthetic sessions are identical across runs and machines.
+class syntheticAxes {
+    public:
+        syntheticAxes(uint64_t seed) : state(seed * 6364136223846793005ULL + 1442695040888963407ULL) {}
+
+        void next(uint32_t tick, nimbleAxisValues &axes, actuatorStatus &status)
+        {
+            if (tick >= segmentEnd) newSegment(tick, axes, status);
+
+            // Triangle stroke between the segment bounds
+            uint32_t phase = (tick - segmentStart) % strokeTicks;
+            uint32_t half = strokeTicks / 2;
+            int32_t span = strokeHigh - strokeLow;
+            int32_t offset = (phase < half) ? span * phase / half : span * (strokeTicks - phase) / (strokeTicks - half);
+            axes.position = strokeLow + offset;
+        }
+
+    private:
+        uint64_t state;
+        uint32_t segmentStart = 0;
+        uint32_t segmentEnd = 0;
+        uint32_t strokeTicks = 1;
+        int32_t strokeLow = 0;
+        int32_t strokeHigh = 0;
+
+        uint32_t random(uint32_t range)
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            return (uint32_t)(state >> 33) % range;
+        }
+
+        void newSegment(uint32_t tick, nimbleAxisValues &axes, actuatorStatus &status)
+        {
+            segmentStart = tick;
+            segmentEnd = tick + 500 + random(5000); // 1 to 11 seconds
+            strokeTicks = 20 + random(500);         // 0.04 to 1 second strokes, fast ones exercise the slew clamp
+            strokeLow = random(AXIS_MAX / 2);
+            strokeHigh = strokeLow + random(AXIS_MAX + 1 - strokeLow);
+            if (random(3) == 0) axes.vibration = random(AXIS_MAX + 1); else if (random(2) == 0) axes.vibration = 0;
+            if (random(4) == 0) axes.vibSpeed = random(AXIS_MAX + 1);
+            if (random(4) == 0) axes.force = random(AXIS_MAX + 1);
+            if (random(8) == 0) axes.air = random(AXIS_MAX + 1);
+            if (random(8) == 0) axes.slew = random(AXIS_MAX + 1);
+            status.tempLimiting = (random(16) == 0);
+            status.sensorFault = (random(64) == 0);
+            status.missing = (random(64) == 0);
+            status.stopped = (random(16) == 0);
+        }
+};
+
+// Runs nimbleMotion::step() like NimbleTCode::updateActuator(), with simulated actuator replies.
+class motionPipeline {
+    public:
+        nimbleMotion motion;
+
+        void tick(uint32_t now, const nimbleAxisValues &axes, const actuatorStatus &status,
+                  uint8_t packet[ACT_PACKET_SIZE])
+        {
+            int64_t nowMicros = (int64_t)now * 1000;
+            nimbleCommand command = motion.step(axes, nowMicros, !status.stopped);
+            encodeActPacket(packet, command.position, command.force, false, command.airOut, command.airIn);
+
+            // The actuator's reply arrives halfway to the next tick
+            if (!status.missing) {
+                motion.supervisor.onReply(status.tempLimiting, status.sensorFault, nowMicros + TICK_MILLIS * 500);
+            }
+        }
+};
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static sessionResult runSession(const session &s, bool keepData)
+{
+    sessionResult result;
+    result.hash = 14695981039346656037ULL;
+    motionPipeline pipeline;
+    nimbleAxisValues axes;
+    actuatorStatus status;
+    uint8_t packet[ACT_PACKET_SIZE];
+
+    auto emit = [&]() {
+        result.hash = fnv1a(result.hash, packet, ACT_PACKET_SIZE);
+        result.packets++;
+        if (keepData) result.data.insert(result.data.end(), packet, packet + ACT_PACKET_SIZE);
+    };
+
+    if (s.rows.empty()) {
+        syntheticAxes generator(s.seed);
+        if (keepData) result.data.reserve((size_t)s.ticks * ACT_PACKET_SIZE);
+        for (uint32_t tick = 0; tick < s.ticks; tick++) {
+            generator.next(tick, axes, status);
+            pipeline.tick(tick * TICK_MILLIS, axes, status, packet);
+            emit();
+        }
+    } else {
+        size_t row = 0;
+        uint32_t end = s.rows.back().ms;
+        for (uint32_t tick = 0; tick * TICK_MILLIS <= end; tick++) {
+            uint32_t now = tick * TICK_MILLIS;
+            for (; row < s.rows.size() && s.rows[row].ms <= now; row++) {
+                axes = s.rows[row].axes;
+                status = s.rows[row].status;
+            }
+            pipeline.tick(now, axes, status, packet);
+            emit();
+        }
+    }
+    result.events = pipeline.motion.supervisor.events;
+    result.maxReactionTicks = pipeline.motion.supervisor.maxReactionTicks;
+    result.maxReactionMicros = pipeline.motion.supervisor.maxReactionMicros;
+    return result;
+}
+
+// Columns of the rows before any header row
+static const char *const DEFAULT_COLUMNS[] = { "ms", "L0", "V0", "A0", "A1", "A2", "temp", "fault", "missing", "stopped" };
+
+static bool setColumn(sessionRow &row, const std::string &column, long value)
+{
+    if (column == "ms") row.ms = value;
+    else if (column == "L0") row.axes.position = value;
+    else if (column == "V0") row.axes.vibration = value;
+    else if (column == "A0") row.axes.air = value;
+    else if (column == "A1") row.axes.force = value;
+    else if (column == "A2") row.axes.vibSpeed = value;
+    else if (column == "A3") row.axes.slew = value;
+    else if (column == "temp") row.status.tempLimiting = value;
+    else if (column == "fault") row.status.sensorFault = value;
+    else if (column == "missing") row.status.missing = value;
+    else if (column == "stopped") row.status.stopped = value;
+    else return false;
+    return true;
+}
+
+static std::vector<std::string> splitColumns(const char *line)
+{
+    std::vector<std::string> fields(1);
+    for (const char *c = line; *c && *c != '\r' && *c != '\n'; c++) {
+        if (*c == ',') fields.emplace_back();
+        else fields.back() += *c;
+    }
+    return fields;
+}
+
+static bool loadSession(const char *path, session &s)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open session %s\n", path);
+        return false;
+    }
+    s.name = path;
+    std::vector<std::string> columns(std::begin(DEFAULT_COLUMNS), std::end(DEFAULT_COLUMNS));
+    bool header = false;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+        if (strncmp(line, "ms,", 3) == 0) {
+            sessionRow unused;
+            columns = splitColumns(line);
+            for (const std::string &column : columns) {
+                if (!setColumn(unused, column, 0)) {
+                    fprintf(stderr, "%s: unknown column %s\n", path, column.c_str());
+                    fclose(f);
+                    return false;
+                }
+            }
+            header = true;
+            continue;
+        }
+
+        std::vector<std::string> fields = splitColumns(line);
+        bool valid = header ? fields.size() == columns.size()
+                            : fields.size() == 6 || fields.size() == 9 || fields.size() == 10;
+        sessionRow row;
+        for (size_t i = 0; valid && i < fields.size(); i++) {
+            char *end;
+            long value = strtol(fields[i].c_str(), &end, 10);
+            valid = (*end == 0 && end != fields[i].c_str());
+            setColumn(row, columns[i], value);
+        }
+        if (!valid) {
+            fprintf(stderr, "%s: skipping malformed row: %s", path, line);
+            continue;
+        }
+        if (!s.rows.empty() && row.ms < s.rows.back().ms) {
+            fprintf(stderr, "%s: rows must be in time order\n", path);
+            fclose(f);
+            return false;
+        }
+        s.rows.push_back(row);
+    }
+    fclose(f);
+    if (s.rows.empty()) {
+        fprintf(stderr, "%s: no rows\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool writeGolden(const char *path, const std::vector<sessionResult> &results)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Cannot write golden %s\n", path);
+        return false;
+    }
+    uint32_t header[2] = { GOLDEN_VERSION, (uint32_t)results.size() };
+    fwrite(GOLDEN_MAGIC, 1, 4, f);
+    fwrite(header, sizeof(header), 1, f);
+    for (const sessionResult &r : results) {
+        fwrite(&r.packets, sizeof(r.packets), 1, f);
+        fwrite(r.data.data(), 1, r.data.size(), f);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool readGolden(const char *path, std::vector<std::vector<uint8_t>> &golden)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open golden %s\n", path);
+        return false;
+    }
+    char magic[4];
+    uint32_t header[2];
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, GOLDEN_MAGIC, 4) != 0
+        || fread(header, sizeof(header), 1, f) != 1 || header[0] != GOLDEN_VERSION) {
+        fprintf(stderr, "%s: not a golden file (version %d)\n", path, GOLDEN_VERSION);
+        fclose(f);
+        return false;
+    }
+    golden.resize(header[1]);
+    for (std::vector<uint8_t> &data : golden) {
+        uint32_t packets;
+        if (fread(&packets, sizeof(packets), 1, f) != 1) break;
+        data.resize((size_t)packets * ACT_PACKET_SIZE);
+        if (fread(data.data(), 1, data.size(), f) != data.size()) break;
+    }
+    fclose(f);
+    return true;
+}
+
+static void describePacket(const uint8_t *p, char *out, size_t size)
+{
+    int position = ((p[2] & 0x03) << 8) | p[1];
+    if (p[2] & 0x04) position = -position;
+    int force = (p[4] << 8) | p[3];
+    const char *air = (p[0] & 0x04) ? "in" : (p[0] & 0x02) ? "out" : "off";
+    snprintf(out, size, "pos %5d force %4d air %-3s", position, force, air);
+}
+
+// Returns the number of differing packets across all sessions.
+static uint64_t compareGolden(const std::vector<session> &sessions, const std::vector<sessionResult> &results,
+                              const std::vector<std::vector<uint8_t>> &golden, int maxDiffs)
+{
+    uint64_t diffs = 0;
+    int printed = 0;
+    if (golden.size() != results.size())
+        printf("Session count differs: golden %zu, current %zu\n", golden.size(), results.size());
+
+    for (size_t i = 0; i < results.size() && i < golden.size(); i++) {
+        const std::vector<uint8_t> &expected = golden[i];
+        const std::vector<uint8_t> &actual = results[i].data;
+        size_t packets = std::min(expected.size(), actual.size()) / ACT_PACKET_SIZE;
+        uint64_t sessionDiffs = 0;
+
+        for (size_t p = 0; p < packets; p++) {
+            const uint8_t *e = &expected[p * ACT_PACKET_SIZE];
+            const uint8_t *a = &actual[p * ACT_PACKET_SIZE];
+            if (memcmp(e, a, ACT_PACKET_SIZE) == 0) continue;
+            sessionDiffs++;
+            if (printed++ < maxDiffs) {
+                char before[64], after[64];
+                describePacket(e, before, sizeof(before));
+                describePacket(a, after, sizeof(after));
+                printf("  %s tick %zu (%zu ms): golden [%s] now [%s]\n",
+                       sessions[i].name.c_str(), p, p * TICK_MILLIS, before, after);
+            }
+        }
+        if (expected.size() != actual.size()) {
+            printf("  %s: packet count differs: golden %zu, current %zu\n", sessions[i].name.c_str(),
+                   expected.size() / ACT_PACKET_SIZE, actual.size() / ACT_PACKET_SIZE);
+            sessionDiffs += (std::max(expected.size(), actual.size()) / ACT_PACKET_SIZE) - packets;
+        }
+        diffs += sessionDiffs;
+    }
+    return diffs;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: program [--session FILE]... [--synthetic N] [--ticks N] [--seed N] [--threads N]\n"
+                    "               [--write-golden FILE] [--golden FILE] [--max-diffs N]\n");
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<session> sessions;
+    int synthetic = -1;
+    uint32_t ticks = 30000;
+    uint64_t seed = 1;
+    unsigned threads = std::thread::hardware_concurrency();
+    const char *writeGoldenPath = nullptr;
+    const char *goldenPath = nullptr;
+    int maxDiffs = 10;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (!value) {
+            usage();
+            return 2;
+        }
+        i++;
+        if (!strcmp(arg, "--session")) {
+            session s;
+            if (!loadSession(value, s)) return 2;
+            sessions.push_back(s);
+        }
+        else if (!strcmp(arg, "--synthetic")) synthetic = atoi(value);
+        else if (!strcmp(arg, "--ticks")) ticks = strtoul(value, nullptr, 10);
+        else if (!strcmp(arg, "--seed")) seed = strtoull(value, nullptr, 10);
+        else if (!strcmp(arg, "--threads")) threads = atoi(value);
+        else if (!strcmp(arg, "--write-golden")) writeGoldenPath = value;
+        else if (!strcmp(arg, "--golden")) goldenPath = value;
+        else if (!strcmp(arg, "--max-diffs")) maxDiffs = atoi(value);
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (synthetic < 0) synthetic = sessions.empty() ? 256 : 0;
+    for (int i = 0; i < synthetic; i++) {
+        session s;
+        s.name = "synthetic#" + std::to_string(i);
+        s.ticks = ticks;
+        s.seed = seed + i;
+        sessions.push_back(s);
+    }
+    if (sessions.empty()) {
+        usage();
+        return 2;
+    }
+    if (threads == 0) threads = 1;
+
+    // Sessions are independent: workers pull the next one until all are done.
+    bool keepData = writeGoldenPath || goldenPath;
+    std::vector<sessionResult> results(sessions.size());
+    std::atomic<size_t> nextSession(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            for (size_t i = nextSession++; i < sessions.size(); i = nextSession++)
+                results[i] = runSession(sessions[i], keepData);
+        });
+    }
+    for (std::thread &w : workers) w.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t totalTicks = 0;
+    uint64_t events = 0;
+    int32_t maxReactionTicks = -1;
+    int64_t maxReactionMicros = -1;
+    uint64_t hash = 14695981039346656037ULL;
+    for (const sessionResult &r : results) {
+        totalTicks += r.packets;
+        events += r.events;
+        maxReactionTicks = std::max(maxReactionTicks, r.maxReactionTicks);
+        maxReactionMicros = std::max(maxReactionMicros, r.maxReactionMicros);
+        hash = fnv1a(hash, (const uint8_t *)&r.hash, sizeof(r.hash));
+    }
+    printf("Sessions: %zu, threads: %u\n", sessions.size(), threads);
+    printf("   Ticks: %llu in %.3f s\n", (unsigned long long)totalTicks, seconds);
+    printf("Ticks/s: %.0f (%.0f per thread)\n", totalTicks / seconds, totalTicks / seconds / threads);
+    printf("  Output: %016llx\n", (unsigned long long)hash);
+    printf("Supervisor: %llu events, max reaction %d ticks (%lld us simulated)\n", (unsigned long long)events,
+           maxReactionTicks, (long long)maxReactionMicros);
+
+    if (writeGoldenPath) {
+        if (!writeGolden(writeGoldenPath, results)) return 2;
+        printf("Golden written: %s\n", writeGoldenPath);
+    }
+    if (goldenPath) {
+        std::vector<std::vector<uint8_t>> golden;
+        if (!readGolden(goldenPath, golden)) return 2;
+        uint64_t diffs = compareGolden(sessions, results, golden, maxDiffs);
+        if (diffs) {
+            printf("Golden: %llu packets differ\n", (unsigned long long)diffs);
+            return 1;
+        }
+        printf("Golden: bit-exact\n");
+    }
+    return 0;
+}
@@ -1,86 +1,193 @@
 #include <Arduino.h>
+#include <assert.h>
 #include <TCode.h>
+#include <Preferences.h>
+#include <esp_timer.h>
 #include "nimbleConModule.h"
 
-#define MAX_POSITION_DELTA 50
-#define VIBRATION_MAX_AMP 25
-#define VIBRATION_MAX_SPEED 20.0 // hz
-
-struct nimbleFrameState {
-    int16_t targetPos = 0; // target position from tcode commands
-    int16_t position = 0; // next position to send to actuator (-1000 to 1000)
-    int16_t lastPos = 0; // previous frame's position
-    int16_t force = IDLE_FORCE; // next force value to send to actuator (0 to 1023)
-    int8_t air = 0; // next air state to send to actuator (-1 = air out, 0 = stop, 1 = air in)
-    int16_t vibrationPos = 0; // next vibration position
+#define TCODE_CHANNELS 8 // Channels per axis type in the shared parser (L0-L7, V0-V7, A0-A7)
+
+#define SETTINGS_NAMESPACE "nimble"
+#define SETTINGS_KEY "state"
+#define SETTINGS_VERSION 2
+#define SETTINGS_SAVE_DELAY 2000 // ms of no setting changes (and no motion while running) before writing to NVS
+
+// Tuned settings persisted to NVS. Stored as their raw axis values (0 to 9999)
+// so restoring them goes through the same mapping as tcode.
+struct nimbleSettings {
+    uint16_t version = SETTINGS_VERSION;
+    uint16_t forceAxis = AXIS_MAX;    // A1 axis value
+    uint16_t vibSpeedAxis = AXIS_MAX; // A2 axis value
+    uint16_t slewAxis = AXIS_MAX;     // A3 axis value
+};
+
+// TCode axis names used to address one actuator (channels must be below TCODE_CHANNELS)
+struct nimbleAxisSet {
+    const char *position;  // Up/down position
+    const char *vibration; // Vibration amplitude
+    const char *air;       // Air in/out valve
+    const char *force;     // Force
+    const char *vibSpeed;  // Vibration speed
+    const char *slew;      // Slew limit
 };
 
+const nimbleAxisSet NIMBLE_AXES_PRIMARY = { "L0", "V0", "A0", "A1", "A2", "A3" };
+const nimbleAxisSet NIMBLE_AXES_SECONDARY = { "L1", "V1", "A4", "A5", "A6", "A7" };
+
 class NimbleTCode {
     public:
-        NimbleTCode(const String &firmware) { tcode = new TCode<3>(firmware); }
-        ~NimbleTCode() { delete tcode; }
+        // Each instance drives the actuator on `port`, addressed by the `axes` names registered
+        // on the shared `tcode` parser. `sendSlot` (0 to MAX_ACTUATORS - 1) staggers its packets
+        // from the other instances.
+        NimbleTCode(TCode<TCODE_CHANNELS> &tcode,
+                    HardwareSerial &port = actSerial,
+                    const nimbleAxisSet &axes = NIMBLE_AXES_PRIMARY,
+                    byte sendSlot = 0)
+            : tcode(&tcode), port(port), axes(axes), sendSlot(sendSlot), nextSendTick(sendSlot)
+        {
+            assert(sendSlot < MAX_ACTUATORS); // A shared slot would send two packets in one interval
+            actuator.forceCommand = IDLE_FORCE;
+            if (this->sendSlot == 0) snprintf(settingsKey, sizeof(settingsKey), "%s", SETTINGS_KEY);
+            else snprintf(settingsKey, sizeof(settingsKey), "%s%d", SETTINGS_KEY, this->sendSlot);
+        }
         void init();
         void resetState();
         void start() { running = true; }
-        void stop() { tcode->stop(); running = false; }
+        void stop();
         void toggle() { if (running) stop(); else start(); }
-        void inputByte(byte input) { tcode->inputByte(input); }
         void updateActuator();
         void updateEncoderLEDs(bool isOn = true);
         void updateHardwareLEDs();
         void updateNetworkLEDs(uint32_t bluetooth, uint32_t wifi);
-        void setVibrationSpeed(float v) { vibrationSpeed = min(max(v, (float)0), (float)VIBRATION_MAX_SPEED); }
-        void setVibrationAmplitude(uint16_t v) { vibrationAmplitude = min(max(v, (uint16_t)0), (uint16_t)VIBRATION_MAX_AMP); }
+        void setVibrationSpeed(float v) { motion.vibrationSpeed = min(max(v, (float)0), (float)VIBRATION_MAX_SPEED); }
+        void setVibrationAmplitude(uint16_t v) { motion.vibrationAmplitude = min(max(v, (uint16_t)0), (uint16_t)VIBRATION_MAX_AMP); }
+        void saveSettings();
         void printFrameState(Print& out = Serial);
         bool isRunning() { return running; }
-        void setMessageCallback(TCODE_FUNCTION_PTR_T function) { tcode->setMessageCallback(function); }
+        int64_t bootToFirstPacketMicros() { return firstPacketMicros; }
+        int64_t supervisorReactionMicros() { return motion.supervisor.reactionMicros; }
 
     private:
-        TCode<3> *tcode;
+        TCode<TCODE_CHANNELS> *tcode; // Shared with the other instances
+        HardwareSerial &port;
+        nimbleAxisSet axes;
+        Actuator actuator = {};
+        ActPacketDecoder decoder = {};
+        byte sendSlot;
+        uint32_t nextSendTick;
+        char settingsKey[12];
         bool running = true;
-        float vibrationSpeed = VIBRATION_MAX_SPEED; // hz
-        uint16_t vibrationAmplitude = 0; // amplitude in position units (0 to 25)
-        nimbleFrameState frame;
-
+        nimbleAxisValues axisValues; // Latest values read from this instance's axes
+        nimbleMotion motion;
+        nimbleSettings settings;
+        bool settingsDirty = false;
+        unsigned long settingsChangedAt = 0;
+        unsigned long positionChangedAt = 0;
+        int64_t firstPacketMicros = -1; // time since boot of the first packet sent to the actuator
+
+        void loadSettings();
+        void markSettingsChanged();
+        void handleSaveSettings();
         void handleAxisChanges();
         void handleVibrationSpeedChanges();
         void handlePositionChanges();
         void handleAirChanges();
         void handleForceChanges();
-        int16_t clampPositionDelta();
+        void handleSlewChanges();
 };
 
+// Call after initNimbleConModule() and tcode.init()
 void NimbleTCode::init()
 {
-    initNimbleConModule();
+    loadSettings();
     resetState();
+    axisValues.force = settings.forceAxis;
+    axisValues.vibSpeed = settings.vibSpeedAxis;
+    axisValues.slew = settings.slewAxis;
+
+    tcode->axisRegister(axes.position, F("Up")); // Up stroke position
+    tcode->axisWrite(axes.position, 5000, ' ', 0); // 5000: midpoint
+    tcode->axisEasingType(axes.position, EasingType::EASEINOUT);
 
-    tcode->init();
+    tcode->axisRegister(axes.vibration, F("Vibe")); // Vibration Amplitude
+    tcode->axisWrite(axes.vibration, 0, ' ', 0);    // 0: vibration off
+    tcode->axisEasingType(axes.vibration, EasingType::EASEINOUT);
 
-    tcode->axisRegister("L0", F("Up")); // Up stroke position
-    tcode->axisWrite("L0", 5000, ' ', 0); // 5000: midpoint
-    tcode->axisEasingType("L0", EasingType::EASEINOUT);
+    tcode->axisRegister(axes.air, F("Air")); // Air in/out valve
+    tcode->axisWrite(axes.air, 5000, ' ', 0); // 0: air out, 5000: stop, 9999: air in
 
-    tcode->axisRegister("V0", F("Vibe")); // Vibration Amplitude
-    tcode->axisWrite("V0", 0, ' ', 0);    // 0: vibration off
-    tcode->axisEasingType("V0", EasingType::EASEINOUT);
+    tcode->axisRegister(axes.force, F("Force"));
+    tcode->axisWrite(axes.force, settings.forceAxis, ' ', 0); // 9999: max force (default)
 
-    tcode->axisRegister("A0", F("Air")); // Air in/out valve
-    tcode->axisWrite("A0", 5000, ' ', 0); // 0: air out, 5000: stop, 9999: air in
+    tcode->axisRegister(axes.vibSpeed, F("VibeSpeed"));
+    tcode->axisWrite(axes.vibSpeed, settings.vibSpeedAxis, ' ', 0); // 9999: max vibration speed (default)
 
-    tcode->axisRegister("A1", F("Force"));
-    tcode->axisWrite("A1", 9999, ' ', 0); // 9999: max force
+    tcode->axisRegister(axes.slew, F("Slew"));
+    tcode->axisWrite(axes.slew, settings.slewAxis, ' ', 0); // 9999: max position change per packet (default)
+}
 
-    tcode->axisRegister("A2", F("VibeSpeed"));
-    tcode->axisWrite("A2", 9999, ' ', 0); // 9999: max vibration speed
+// Stops the moves in progress on this instance's axes only, the parser is shared.
+void NimbleTCode::stop()
+{
+    tcode->axisWrite(axes.position, tcode->axisRead(axes.position), ' ', 0);
+    tcode->axisWrite(axes.vibration, tcode->axisRead(axes.vibration), ' ', 0);
+    running = false;
+    if (settingsDirty) saveSettings(); // Nothing is moving now
 }
 
+// Force, vibration speed and slew are settings and keep their current values.
 void NimbleTCode::resetState() {
-    frame.targetPos = 0;
-    frame.force = MAX_FORCE;
-    frame.air = 0;
-    vibrationSpeed = VIBRATION_MAX_SPEED;
-    vibrationAmplitude = 0;
+    axisValues.position = 5000;
+    axisValues.vibration = 0;
+    axisValues.air = 5000;
+}
+
+void NimbleTCode::loadSettings()
+{
+    Preferences prefs;
+    if (!prefs.begin(SETTINGS_NAMESPACE, true)) return; // Namespace does not exist yet: keep defaults
+
+    nimbleSettings stored;
+    if (prefs.getBytesLength(settingsKey) == sizeof(stored)
+        && prefs.getBytes(settingsKey, &stored, sizeof(stored)) == sizeof(stored)
+        && stored.version == SETTINGS_VERSION)
+    {
+        settings.forceAxis = min(stored.forceAxis, (uint16_t)AXIS_MAX);
+        settings.vibSpeedAxis = min(stored.vibSpeedAxis, (uint16_t)AXIS_MAX);
+        settings.slewAxis = min(stored.slewAxis, (uint16_t)AXIS_MAX);
+    }
+    prefs.end();
+}
+
+void NimbleTCode::saveSettings()
+{
+    Preferences prefs;
+    settingsDirty = false;
+    if (!prefs.begin(SETTINGS_NAMESPACE, false)) return;
+
+    nimbleSettings stored;
+    if (prefs.getBytes(settingsKey, &stored, sizeof(stored)) != sizeof(stored)
+        || memcmp(&stored, &settings, sizeof(stored)) != 0)
+    {
+        prefs.putBytes(settingsKey, &settings, sizeof(settings)); // Only write flash when something changed
+    }
+    prefs.end();
+}
+
+void NimbleTCode::markSettingsChanged()
+{
+    settingsDirty = true;
+    settingsChangedAt = millis();
+}
+
+void NimbleTCode::handleSaveSettings()
+{
+    // Debounce writes so a host sweeping an axis does not wear out the flash.
+    if (!settingsDirty || millis() - settingsChangedAt < SETTINGS_SAVE_DELAY) return;
+    // A flash write can block for tens of ms and delay the next packets, so while running
+    // wait until the actuator is holding still (stop() saves right away).
+    if (running && (axisValues.vibration != 0 || millis() - positionChangedAt < SETTINGS_SAVE_DELAY)) return;
+    saveSettings();
 }
 
 void NimbleTCode::handleAxisChanges()
@@ -89,105 +196,79 @@ void NimbleTCode::handleAxisChanges()
     handlePositionChanges();
     handleAirChanges();
     handleForceChanges();
+    handleSlewChanges();
 }
 
 void NimbleTCode::handleVibrationSpeedChanges()
 {
-    if (!tcode->axisChanged("A2")) return;
-    int val = tcode->axisRead("A2");
-    int maxSpeed = VIBRATION_MAX_SPEED * 100;
-    int newSpeed = map(val, 0, 9999, 0, maxSpeed);
-    vibrationSpeed = float(newSpeed) / 100;
+    if (!tcode->axisChanged(axes.vibSpeed)) return;
+    int val = tcode->axisRead(axes.vibSpeed);
+    axisValues.vibSpeed = val;
+    if (val != settings.vibSpeedAxis) {
+        settings.vibSpeedAxis = val;
+        markSettingsChanged();
+    }
 }
 
 void NimbleTCode::handlePositionChanges()
 {
-    if (!tcode->axisChanged("L0")) {
-        int val = tcode->axisRead("L0");
-        frame.targetPos = map(val, 0, 9999, -ACTUATOR_MAX_POS, ACTUATOR_MAX_POS);
+    int32_t lastPosition = axisValues.position;
+    if (!tcode->axisChanged(axes.position)) {
+        axisValues.position = tcode->axisRead(axes.position);
     }
+    if (axisValues.position != lastPosition) positionChangedAt = millis();
 
-    if (this->tcode->axisChanged("V0")) {
-        int val = tcode->axisRead("V0");
-        vibrationAmplitude = map(val, 0, 9999, 0, VIBRATION_MAX_AMP);
+    if (this->tcode->axisChanged(axes.vibration)) {
+        axisValues.vibration = tcode->axisRead(axes.vibration);
     }
-
-    if (vibrationAmplitude > 0 && vibrationSpeed > 0) {
-        int vibSpeedMillis = 1000 / vibrationSpeed;
-        int vibModMillis = millis() % vibSpeedMillis;
-        float tempPos = float(vibModMillis) / vibSpeedMillis;
-        int vibWaveDeg = tempPos * 360;
-        frame.vibrationPos = round(sin(radians(vibWaveDeg)) * vibrationAmplitude);
-    } else {
-        frame.vibrationPos = 0;
-    }
-    // Serial.printf("A:%5d S:%0.2f P:%5d\n",
-    //     vibrationAmplitude,
-    //     vibrationSpeed,
-    //     vibrationPos
-    // );
-
-    int targetPosTmp = frame.targetPos;
-    if (frame.targetPos - vibrationAmplitude < -ACTUATOR_MAX_POS) {
-        targetPosTmp = frame.targetPos + vibrationAmplitude;
-    } else if (frame.targetPos + vibrationAmplitude > ACTUATOR_MAX_POS) {
-        targetPosTmp = frame.targetPos - vibrationAmplitude;
-    }
-    frame.position = targetPosTmp + frame.vibrationPos;
 }
 
 void NimbleTCode::handleAirChanges()
 {
-    if (!tcode->axisChanged("A0")) return;
-    int val = tcode->axisRead("A0");
-
-    //    0-3333 = air out 
-    // 3334-6666 = valve off
-    // 6667-9999 = air in
-    if (val < 3334) {
-        frame.air = -1;
-    } else if (val > 6666) {
-        frame.air = 1;
-    } else {
-        frame.air = 0;
-    }
+    if (!tcode->axisChanged(axes.air)) return;
+    axisValues.air = tcode->axisRead(axes.air);
 }
 
 void NimbleTCode::handleForceChanges()
 {
-    if (!tcode->axisChanged("A1")) return;
-    int val = tcode->axisRead("A1");
-    frame.force = map(val, 0, 9999, 0, MAX_FORCE);
+    if (!tcode->axisChanged(axes.force)) return;
+    int val = tcode->axisRead(axes.force);
+    axisValues.force = val;
+    if (val != settings.forceAxis) {
+        settings.forceAxis = val;
+        markSettingsChanged();
+    }
+}
+
+void NimbleTCode::handleSlewChanges()
+{
+    if (!tcode->axisChanged(axes.slew)) return;
+    int val = tcode->axisRead(axes.slew);
+    axisValues.slew = val;
+    if (val != settings.slewAxis) {
+        settings.slewAxis = val;
+        markSettingsChanged();
+    }
 }
 
 void NimbleTCode::updateActuator()
 {
     handleAxisChanges();
     // Send packet of values to the actuator when time is ready
-    if (checkTimer())
+    if (checkTimerSlot(nextSendTick, sendSlot))
     {
-        if (isRunning()) {
-            frame.lastPos = clampPositionDelta();
-            actuator.positionCommand = frame.lastPos;
-            actuator.forceCommand = frame.force;
-            actuator.airIn = (frame.air > 0);
-            actuator.airOut = (frame.air < 0);
-        } else {
-            actuator.airIn = false;
-            actuator.airOut = false;
-            actuator.forceCommand = IDLE_FORCE;
-        }
-        sendToAct();
+        nimbleCommand command = motion.step(axisValues, esp_timer_get_time(), isRunning());
+        actuator.positionCommand = command.position;
+        actuator.forceCommand = command.force;
+        actuator.airIn = command.airIn;
+        actuator.airOut = command.airOut;
+        sendToAct(actuator, port);
+        if (firstPacketMicros < 0) firstPacketMicros = esp_timer_get_time();
     }
 
-    if (readFromAct()) // Read current state from actuator.
+    if (readFromAct(actuator, port, decoder)) // Read current state from actuator.
     { // If the function returns true, the values were updated.
-
-        // Unclear yet if any action is required when tempLimiting is occurring.
-        // A comparison is needed with the Pendant behavior.
-        // if (actuator.tempLimiting) {
-        //     setRunMode(RUN_MODE_OFF);
-        // }
+        motion.supervisor.onReply(actuator.tempLimiting, actuator.sensorFault, esp_timer_get_time());
 
         // Serial.printf("A P:%4d F:%4d T:%s\n",
         //     actuator.positionFeedback,
@@ -195,12 +276,14 @@ void NimbleTCode::updateActuator()
         //     actuator.tempLimiting ? "true" : "false"
         // );
     }
+
+    handleSaveSettings();
 }
 
 void NimbleTCode::updateEncoderLEDs(bool isOn)
 {
-    int16_t pos = frame.lastPos;
-    int16_t vibPos = frame.vibrationPos;
+    int16_t pos = motion.frame.lastPos;
+    int16_t vibPos = motion.frame.vibrationPos;
 
     byte ledScale = map(abs(pos), 0, ACTUATOR_MAX_POS, 1, LED_MAX_DUTY);
     byte ledState1 = 0;
@@ -248,25 +331,27 @@ void NimbleTCode::updateNetworkLEDs(uint32_t bluetooth, uint32_t wifi)
     ledcWrite(WIFI_LED, wifi);
 }
 
-int16_t NimbleTCode::clampPositionDelta()
-{
-    int16_t delta = frame.position - frame.lastPos;
-    if (delta >= 0) {
-        return (delta > MAX_POSITION_DELTA) ? frame.lastPos + MAX_POSITION_DELTA : frame.position;
-    } else {
-        return (delta < -MAX_POSITION_DELTA) ? frame.lastPos - MAX_POSITION_DELTA : frame.position;
-    }
-}
-
 void NimbleTCode::printFrameState(Print& out)
 {
     out.printf("------------------\n");
-    out.printf("   VibAmp: %5d\n", vibrationAmplitude);
-    out.printf(" VibSpeed: %0.2f (hz)\n", vibrationSpeed);
-    out.printf("   TarPos: %5d\n", frame.targetPos);
-    out.printf("      Pos: %5d\n", frame.position);
+    out.printf("   VibAmp: %5d\n", motion.vibrationAmplitude);
+    out.printf(" VibSpeed: %0.2f (hz)\n", motion.vibrationSpeed);
+    out.printf("   TarPos: %5d\n", motion.frame.targetPos);
+    out.printf("      Pos: %5d\n", motion.frame.position);
     out.printf("    Force: %5d\n", actuator.forceCommand);
     out.printf("    AirIn: %s\n", actuator.airIn ? "true" : "false");
     out.printf("   AirOut: %s\n", actuator.airOut ? "true" : "false");
     out.printf("TempLimit: %s\n", actuator.tempLimiting ? "true" : "false");
+    out.printf(" MaxDelta: %5d\n", motion.maxPositionDelta);
+    out.printf("BootToAct: %lld (us)\n", firstPacketMicros);
+    out.printf("SensFault: %s (latched: %s)\n", actuator.sensorFault ? "true" : "false",
+        motion.supervisor.sensorFault ? "true" : "false");
+    out.printf("  Missing: %s\n", motion.supervisor.missing() ? "true" : "false");
+    out.printf("     Gain: %5d/%d\n", motion.supervisor.gain, SUPERVISOR_GAIN_MAX);
+    out.printf(" Reaction: %d us (%d ticks, %s), max %d us (%d ticks)\n",
+        (int)supervisorReactionMicros(),
+        (int)motion.supervisor.reactionTicks,
+        motion.supervisor.lastEvent,
+        (int)motion.supervisor.maxReactionMicros,
+        (int)motion.supervisor.maxReactionTicks);
 }
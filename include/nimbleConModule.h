@@ -2,6 +2,7 @@
 // From https://github.com/ExploratoryDevices/NimbleConModule (with edits)
 #include <ESP32Encoder.h>   // https://github.com/madhephaestus/ESP32Encoder
 #include <HardwareSerial.h> // Arduino Core ESP32 Hardware serial library
+#include "nimbleMotion.h"   // Position/force limits and actuator packet encoding
 
 // min() function needs this to work on ESP32
 #ifndef min
@@ -52,11 +53,12 @@ HardwareSerial actSerial(2);
 
 // Timers for sending serial data to actuator and pendant
 #define SEND_INTERVAL 2000 // microseconds between packets sent.
+#define MAX_ACTUATORS 2    // Send slots per interval, one per actuator so UART writes are phase staggered.
 
 int timeSinceLastActSend = 0;
 int timeSinceLastPendSend = 0;
 
-volatile int timerTriggered;
+volatile uint32_t timerTicks; // Incremented every SEND_INTERVAL / MAX_ACTUATORS microseconds.
 
 hw_timer_t *timer = NULL;
 portMUX_TYPE timerMux = portMUX_INITIALIZER_UNLOCKED;
@@ -64,26 +66,25 @@ portMUX_TYPE timerMux = portMUX_INITIALIZER_UNLOCKED;
 void IRAM_ATTR onTimer()
 {
     portENTER_CRITICAL_ISR(&timerMux);
-    timerTriggered = 1; // Set timer as triggered.
+    timerTicks++; // Advance to the next send slot.
     portEXIT_CRITICAL_ISR(&timerMux);
 }
 
-bool checkTimer()
+// Returns true once per SEND_INTERVAL, on the timer tick assigned to `slot`.
+// `nextTick` holds the caller's schedule and should start out equal to `slot`.
+bool checkTimerSlot(uint32_t &nextTick, byte slot)
 {
-    if (timerTriggered == 1)
-    {
-        portENTER_CRITICAL(&timerMux);
-        timerTriggered = 0; // Clear timer flag
-        portEXIT_CRITICAL(&timerMux);
-        return (1); // Return 1 to indicate timer has triggered
-    }
-    return (0);
+    uint32_t ticks = timerTicks; // 32 bit reads are atomic on the ESP32
+    if ((int32_t)(ticks - nextTick) < 0)
+        return (0);
+
+    // Schedule the first tick after this one that falls on our slot.
+    uint32_t after = ticks + 1;
+    nextTick = after + (slot + MAX_ACTUATORS - after % MAX_ACTUATORS) % MAX_ACTUATORS;
+    return (1); // Return 1 to indicate our slot has triggered
 }
 
 // Pendant Variables
-#define IDLE_FORCE 200 // Centering force to send when no value position signal is received.
-#define MAX_FORCE 1023 // Pendant uses this value as a constant
-
 struct Pendant
 {
     bool present;
@@ -104,8 +105,6 @@ struct Pendant
 struct Pendant pendant; // Declare pendant
 
 // Actuator Variables
-#define ACTUATOR_MAX_POS 750
-
 struct Actuator
 {
     bool present;
@@ -125,7 +124,12 @@ struct Actuator
     bool airIn;           // Set high to open air-in valve  (tighter)
 };
 
-struct Actuator actuator; // Declare actuator
+// Receive state for one actuator serial port
+struct ActPacketDecoder
+{
+    long lastTime;
+    byte incomingPacket[7];
+};
 
 // Initialization fuction
 void initNimbleConModule()
@@ -139,9 +143,8 @@ void initNimbleConModule()
     encoder.attachHalfQuad(ENC_A, ENC_B);
     encoder.setCount(0);
 
-    // Actuator/Pendant defaults
+    // Pendant defaults (actuator defaults are set per NimbleTCode instance)
     pendant.forceCommand = IDLE_FORCE;
-    actuator.forceCommand = IDLE_FORCE;
 
     // Setup serial ports
     Serial.begin(SERIAL_BAUD);                                   // open serial port for USB connection
@@ -151,7 +154,7 @@ void initNimbleConModule()
     // Set up timer interrupt.
     timer = timerBegin(0, 80, true);             // Set timer parameters
     timerAttachInterrupt(timer, &onTimer, true); // Attach interrupt to ISR
-    timerAlarmWrite(timer, SEND_INTERVAL, true); // Configure timer threshold
+    timerAlarmWrite(timer, SEND_INTERVAL / MAX_ACTUATORS, true); // Configure timer threshold
     timerAlarmEnable(timer);                     // Enable timer
 
     // Attach PWM to LED pins (pin, PWM channel)
@@ -225,46 +228,19 @@ void ledPositionPulse(short int position, bool isOn)
     ledcWrite(ENC_LED_E, 0);
 }
 
-void sendToAct()
+void sendToAct(Actuator &actuator, Stream &port)
 {
-    // Parse settings for transmission ------------------------------------------------------------
-
-    byte outgoingPacket[7], statusByte = 0;
-    bool positionNegative = 0;
-    int checkWord;
-
-    if (actuator.positionCommand < 0)
+    byte outgoingPacket[ACT_PACKET_SIZE];
+    encodeActPacket(outgoingPacket,
+                    actuator.positionCommand,
+                    actuator.forceCommand,
+                    actuator.activated,
+                    actuator.airOut,
+                    actuator.airIn);
+
+    for (byte i = 0; i < ACT_PACKET_SIZE; i++)
     {
-        actuator.positionCommand *= -1;
-        positionNegative = 1;
-    }
-    else
-        positionNegative = 0;
-
-    statusByte |= actuator.activated;
-    statusByte |= actuator.airOut << 1;
-    statusByte |= actuator.airIn << 2;
-    statusByte |= 0x80; // SYSTEM_TYPE: NimbleStroker
-
-    outgoingPacket[0] = statusByte;
-    outgoingPacket[1] = actuator.positionCommand & 0xFF;
-    outgoingPacket[2] = actuator.positionCommand >> 8;
-    outgoingPacket[2] |= positionNegative << 2;
-    outgoingPacket[3] = actuator.forceCommand & 0xFF;
-    outgoingPacket[4] = actuator.forceCommand >> 8;
-
-    checkWord = 0;
-    for (byte i = 0; i <= 4; i++)
-    {
-        checkWord += outgoingPacket[i];
-    }
-
-    outgoingPacket[5] = checkWord & 0x00FF;
-    outgoingPacket[6] = checkWord >> 8;
-
-    for (byte i = 0; i <= 6; i++)
-    {
-        actSerial.write(outgoingPacket[i]);
+        port.write(outgoingPacket[i]);
     }
 }
 
@@ -325,11 +301,12 @@ bool readFromPend()
     return (updated);
 }
 
-bool readFromAct()
+bool readFromAct(Actuator &actuator, Stream &port, ActPacketDecoder &decoder)
 {
-    static byte byteCounter = 0, errorCounter = 0, statusByte = 0;
-    static long lastTime = 0, lastPacket = 0;
-    static byte incomingPacket[7];
+    byte statusByte = 0;
+    long &lastTime = decoder.lastTime;
+    long lastPacket = 0;
+    byte *incomingPacket = decoder.incomingPacket;
     int checkWord, checkSum;
     bool updated = 0;
 
@@ -338,12 +315,12 @@ bool readFromAct()
     if (lastPacket > PACKET_TIMEOUT) // If the last packet was more than the timeout ago, set everything to zero.
         actuator.present = false;
 
-    while (actSerial.available()) // Clear pendant incoming serial buffer and fill the incomingPacket array with the first 10 bytes.
+    while (port.available()) // Clear pendant incoming serial buffer and fill the incomingPacket array with the first 10 bytes.
     {
         for (byte i = 1; i <= 6; i++) // Shift all bytes in the array to make room for the new one.
             incomingPacket[i - 1] = incomingPacket[i];
 
-        incomingPacket[6] = actSerial.read(); // put the new byte in the array.
+        incomingPacket[6] = port.read(); // put the new byte in the array.
 
         checkSum = 0; // Reset the checksum before proceeding
         for (byte i = 0; i <= 4; i++)
@@ -0,0 +1,295 @@
+#pragma once
+// Motion processing and actuator packet encoding.
+// Kept free of Arduino/ESP32 dependencies so the same code runs in the native benchmark (bench/).
+#include <stdint.h>
+#include <math.h>
+
+#define ACTUATOR_MAX_POS 750
+#define IDLE_FORCE 200 // Centering force to send when no value position signal is received.
+#define MAX_FORCE 1023 // Pendant uses this value as a constant
+
+#define MAX_POSITION_DELTA 50
+#define VIBRATION_MAX_AMP 25
+#define VIBRATION_MAX_SPEED 20.0 // hz
+
+#define SUPERVISOR_GAIN_MAX 256    // Full force and stroke
+#define SUPERVISOR_TEMP_GAIN 160   // Force and stroke scale while the actuator is thermally limiting (~60%)
+#define SUPERVISOR_RAMP_DOWN 16    // Gain steps per tick when de-rating (full ramp in 16 ticks)
+#define SUPERVISOR_RAMP_UP 1       // Gain steps per tick when recovering (full ramp in 256 ticks)
+#define SUPERVISOR_MISSING_TICKS 3 // Ticks without a reply before the actuator is considered missing
+
+#define AXIS_MAX 9999
+#define ACT_PACKET_SIZE 7
+
+// Same integer math as Arduino's map() for an axis value (0 to 9999).
+inline int32_t mapAxis(int32_t val, int32_t outMin, int32_t outMax)
+{
+    return val * (outMax - outMin) / AXIS_MAX + outMin;
+}
+
+inline int16_t positionFromAxis(int32_t val) { return mapAxis(val, -ACTUATOR_MAX_POS, ACTUATOR_MAX_POS); }
+inline uint16_t vibrationAmplitudeFromAxis(int32_t val) { return mapAxis(val, 0, VIBRATION_MAX_AMP); }
+inline float vibrationSpeedFromAxis(int32_t val) { return float(mapAxis(val, 0, VIBRATION_MAX_SPEED * 100)) / 100; }
+inline int16_t forceFromAxis(int32_t val) { return mapAxis(val, 0, MAX_FORCE); }
+inline int16_t slewFromAxis(int32_t val) { return mapAxis(val, 1, MAX_POSITION_DELTA); }
+
+//    0-3333 = air out
+// 3334-6666 = valve off
+// 6667-9999 = air in
+inline int8_t airFromAxis(int32_t val)
+{
+    if (val < 3334) return -1;
+    if (val > 6666) return 1;
+    return 0;
+}
+
+// Vibration offset (position units) at time `now` (ms) for a sine wave of `speed` hz.
+inline int16_t vibrationOffset(uint32_t now, float speed, uint16_t amplitude)
+{
+    if (amplitude == 0 || speed <= 0) return 0;
+    int vibSpeedMillis = 1000 / speed;
+    int vibModMillis = now % vibSpeedMillis;
+    float tempPos = float(vibModMillis) / vibSpeedMillis;
+    int vibWaveDeg = tempPos * 360;
+    return round(sin(vibWaveDeg * 0.017453292519943295769236907684886) * amplitude);
+}
+
+// Applies the vibration offset to the target, shifting the center so the stroke stays in range.
+inline int16_t vibratedPosition(int16_t targetPos, uint16_t amplitude, int16_t vibrationPos)
+{
+    int targetPosTmp = targetPos;
+    if (targetPos - amplitude < -ACTUATOR_MAX_POS) {
+        targetPosTmp = targetPos + amplitude;
+    } else if (targetPos + amplitude > ACTUATOR_MAX_POS) {
+        targetPosTmp = targetPos - amplitude;
+    }
+    return targetPosTmp + vibrationPos;
+}
+
+// Limits the change in position between two packets (slew limit).
+inline int16_t clampPositionDelta(int16_t position, int16_t lastPos, int16_t maxDelta)
+{
+    int16_t delta = position - lastPos;
+    if (delta >= 0) {
+        return (delta > maxDelta) ? lastPos + maxDelta : position;
+    } else {
+        return (delta < -maxDelta) ? lastPos - maxDelta : position;
+    }
+}
+
+// Safety supervisor, stepped once per actuator tick before the packet is built.
+// Scales force and stroke down when the actuator reports thermal limiting, and ramps
+// them to zero on a sensor fault or when the actuator stops replying. A sensor fault
+// stays latched until clearFault() (the device is started again by the user).
+// Reaction times run from the event (the reply reporting it, or the last reply before the
+// actuator went missing) to the first packet sent at a lower gain, in ticks and in us of the
+// caller's clock. Events that need no de-rating (the gain is already below the new limit)
+// report -1.
+class nimbleSupervisor {
+    public:
+        uint16_t gain = 0; // Starts at zero so motion ramps in once the actuator replies
+        uint16_t ticksSinceReply = SUPERVISOR_MISSING_TICKS + 1;
+        bool tempLimiting = false;
+        bool sensorFault = false; // Latched
+
+        // Instrumentation
+        uint32_t ticks = 0;
+        uint32_t events = 0;
+        const char *lastEvent = "none";
+        int32_t reactionTicks = -1;
+        int32_t maxReactionTicks = -1;
+        int64_t reactionMicros = -1;
+        int64_t maxReactionMicros = -1;
+
+        bool missing() const { return ticksSinceReply > SUPERVISOR_MISSING_TICKS; }
+
+        uint16_t targetGain() const
+        {
+            if (sensorFault || missing()) return 0;
+            if (tempLimiting) return SUPERVISOR_TEMP_GAIN;
+            return SUPERVISOR_GAIN_MAX;
+        }
+
+        // Call with the status from each packet received from the actuator, `now` in us.
+        void onReply(bool temp, bool fault, int64_t now)
+        {
+            if (fault && !sensorFault) startEvent("fault", ticks, now);
+            else if (temp && !tempLimiting) startEvent("temp", ticks, now);
+            ticksSinceReply = 0;
+            lastReplyTick = ticks;
+            lastReplyMicros = now;
+            reportedMissing = false;
+            tempLimiting = temp;
+            sensorFault = sensorFault || fault;
+        }
+
+        void clearFault() { sensorFault = false; }
+
+        // Call once per send tick, `now` in us. Ramps the gain toward its target for this packet.
+        void tick(int64_t now)
+        {
+            ticks++;
+            // The actuator replies to every packet, so a few unanswered packets means it is gone.
+            if (missing() && !reportedMissing) {
+                reportedMissing = true;
+                startEvent("missing", lastReplyTick, lastReplyMicros);
+            }
+
+            uint16_t target = targetGain();
+            uint16_t lastGain = gain;
+            if (gain > target) {
+                gain = (gain - target > SUPERVISOR_RAMP_DOWN) ? gain - SUPERVISOR_RAMP_DOWN : target;
+            } else if (gain < target) {
+                gain = (target - gain > SUPERVISOR_RAMP_UP) ? gain + SUPERVISOR_RAMP_UP : target;
+            }
+            if (ticksSinceReply <= SUPERVISOR_MISSING_TICKS) ticksSinceReply++; // This packet awaits a reply
+
+            if (*pendingEvent) {
+                events++;
+                lastEvent = pendingEvent;
+                if (gain < lastGain) { // This packet is the first one with the de-rated gain
+                    reactionTicks = ticks - eventTick;
+                    reactionMicros = now - eventMicros;
+                    if (reactionTicks > maxReactionTicks) maxReactionTicks = reactionTicks;
+                    if (reactionMicros > maxReactionMicros) maxReactionMicros = reactionMicros;
+                } else { // The gain was already within the new limit, nothing to react to
+                    reactionTicks = -1;
+                    reactionMicros = -1;
+                }
+                pendingEvent = "";
+            }
+        }
+
+        int16_t applyGain(int32_t value) const { return value * gain / SUPERVISOR_GAIN_MAX; }
+
+    private:
+        uint32_t lastReplyTick = 0;
+        int64_t lastReplyMicros = 0;
+        bool reportedMissing = true; // Not present until the first reply
+        const char *pendingEvent = "";
+        uint32_t eventTick = 0;
+        int64_t eventMicros = 0;
+
+        void startEvent(const char *event, uint32_t tick, int64_t micros)
+        {
+            if (*pendingEvent) return; // Keep the earliest event until it is handled
+            pendingEvent = event;
+            eventTick = tick;
+            eventMicros = micros;
+        }
+};
+
+// Latest axis values (0 to 9999) read from tcode
+struct nimbleAxisValues {
+    int32_t position = 5000;     // 5000: midpoint
+    int32_t vibration = 0;       // 0: vibration off
+    int32_t air = 5000;          // 5000: valve off
+    int32_t force = AXIS_MAX;    // 9999: max force
+    int32_t vibSpeed = AXIS_MAX; // 9999: max vibration speed
+    int32_t slew = AXIS_MAX;     // 9999: max position change per packet
+};
+
+struct nimbleFrameState {
+    int16_t targetPos = 0; // target position from tcode commands
+    int16_t position = 0; // next position to send to actuator (-1000 to 1000)
+    int16_t lastPos = 0; // previous frame's position
+    int16_t force = IDLE_FORCE; // next force value to send to actuator (0 to 1023)
+    int8_t air = 0; // next air state to send to actuator (-1 = air out, 0 = stop, 1 = air in)
+    int16_t vibrationPos = 0; // next vibration position
+};
+
+// Values for one packet to the actuator
+struct nimbleCommand {
+    int16_t position = 0;
+    int16_t force = IDLE_FORCE;
+    bool airIn = false;
+    bool airOut = false;
+};
+
+// Motion state of one actuator. step() is the whole per-tick pipeline, shared by
+// NimbleTCode::updateActuator() and the native benchmark.
+class nimbleMotion {
+    public:
+        nimbleFrameState frame;
+        float vibrationSpeed = VIBRATION_MAX_SPEED; // hz
+        uint16_t vibrationAmplitude = 0; // amplitude in position units (0 to 25)
+        int16_t maxPositionDelta = MAX_POSITION_DELTA; // slew limit (position units per packet)
+        nimbleSupervisor supervisor;
+
+        // Call once per send tick, just before the packet is sent, with the latest axis values
+        // and the time in us.
+        // When stopped, the last position is held with the idle force and the valves closed.
+        // Starting again clears a latched sensor fault.
+        nimbleCommand step(const nimbleAxisValues &axes, int64_t nowMicros, bool running)
+        {
+            uint32_t now = nowMicros / 1000; // ms, as millis()
+            // Axis changes since the last tick (the position is re-read every tick)
+            if (axes.vibSpeed != applied.vibSpeed) vibrationSpeed = vibrationSpeedFromAxis(axes.vibSpeed);
+            frame.targetPos = positionFromAxis(axes.position);
+            if (axes.vibration != applied.vibration) vibrationAmplitude = vibrationAmplitudeFromAxis(axes.vibration);
+            if (axes.air != applied.air) frame.air = airFromAxis(axes.air);
+            if (axes.force != applied.force) frame.force = forceFromAxis(axes.force);
+            if (axes.slew != applied.slew) maxPositionDelta = slewFromAxis(axes.slew);
+            applied = axes;
+
+            frame.vibrationPos = vibrationOffset(now, vibrationSpeed, vibrationAmplitude);
+            frame.position = vibratedPosition(frame.targetPos, vibrationAmplitude, frame.vibrationPos);
+
+            if (running && !wasRunning) supervisor.clearFault(); // Started again by the user
+            wasRunning = running;
+            supervisor.tick(nowMicros);
+            if (running) {
+                frame.lastPos = clampPositionDelta(supervisor.applyGain(frame.position), frame.lastPos, maxPositionDelta);
+                command.position = frame.lastPos;
+                command.force = supervisor.applyGain(frame.force);
+                command.airIn = (frame.air > 0);
+                command.airOut = (frame.air < 0);
+            } else {
+                command.airIn = false;
+                command.airOut = false;
+                command.force = supervisor.applyGain(IDLE_FORCE);
+            }
+            return command;
+        }
+
+    private:
+        nimbleAxisValues applied = { -1, -1, -1, -1, -1, -1 }; // Applies every axis on the first tick
+        nimbleCommand command;
+        bool wasRunning = true;
+};
+
+// Encodes one command packet for the actuator.
+inline void encodeActPacket(uint8_t packet[ACT_PACKET_SIZE], long position, long force,
+                            bool activated, bool airOut, bool airIn)
+{
+    uint8_t statusByte = 0;
+    bool positionNegative = 0;
+    int checkWord;
+
+    if (position < 0)
+    {
+        position *= -1;
+        positionNegative = 1;
+    }
+
+    statusByte |= activated;
+    statusByte |= airOut << 1;
+    statusByte |= airIn << 2;
+    statusByte |= 0x80; // SYSTEM_TYPE: NimbleStroker
+
+    packet[0] = statusByte;
+    packet[1] = position & 0xFF;
+    packet[2] = position >> 8;
+    packet[2] |= positionNegative << 2;
+    packet[3] = force & 0xFF;
+    packet[4] = force >> 8;
+
+    checkWord = 0;
+    for (uint8_t i = 0; i <= 4; i++)
+    {
+        checkWord += packet[i];
+    }
+
+    packet[5] = checkWord & 0x00FF;
+    packet[6] = checkWord >> 8;
+}
@@ -5,7 +5,13 @@
 
 #define FIRMWAREVERSION "NimbleStroker_TCode_Serial_v0.4"
 
-NimbleTCode nimble(FIRMWAREVERSION);
+// One parser for the host connection, each actuator registers its own axes on it.
+TCode<TCODE_CHANNELS> tcode(FIRMWAREVERSION);
+NimbleTCode nimble(tcode);
+#ifdef SECOND_ACTUATOR
+// Second actuator wired to the pendant port, addressed with L1/V1/A4/A5/A6/A7
+NimbleTCode nimble2(tcode, pendSerial, NIMBLE_AXES_SECONDARY, 1);
+#endif
 
 millisDelay ledUpdateDelay;
 millisDelay logDelay;
@@ -19,6 +25,10 @@ void pressHandler(BfButton *btn, BfButton::press_pattern_t pattern)
     case BfButton::SINGLE_PRESS:
         nimble.toggle();
         if (!nimble.isRunning()) nimble.resetState();
+#ifdef SECOND_ACTUATOR
+        if (nimble2.isRunning() != nimble.isRunning()) nimble2.toggle();
+        if (!nimble2.isRunning()) nimble2.resetState();
+#endif
         break;
     }
 }
@@ -44,12 +54,16 @@ void updateLEDs()
 void setup()
 {
     // NimbleStroker TCode setup
+    // Don't wait on the USB host: the actuator loop must run whether or not it is attached.
+    initNimbleConModule();
+    tcode.init();
     nimble.init();
-    while (!Serial);
+#ifdef SECOND_ACTUATOR
+    nimble2.init();
+#endif
 
 #ifdef DEBUG
     Serial.setDebugOutput(true);
-    delay(200);
     Serial.println("\nStarting");
 #else
     Serial.setDebugOutput(false);
@@ -67,9 +81,12 @@ void loop()
 {
     btn.read();
     while (Serial.available() > 0) {
-        nimble.inputByte(Serial.read());
+        tcode.inputByte(Serial.read());
     }
     nimble.updateActuator();
+#ifdef SECOND_ACTUATOR
+    nimble2.updateActuator();
+#endif
     updateLEDs();
 #ifdef DEBUG
     logTimer();